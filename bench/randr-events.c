@@ -0,0 +1,357 @@
+/**
+ * xininfo
+ *
+ * MIT/X11 License
+ * Copyright (c) 2014-2015 Qball  Cow <qball@gmpclient.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * Replay recorded RandR event bursts with mmb_screen_apply_events and compare the cost
+ * with rebuilding the layout from scratch.
+ *
+ * randr-events [-n iterations] [file ...]
+ * randr-events -record file seconds
+ *
+ * A burst file holds the raw 32 byte events, with the RandR first event code subtracted
+ * from the response type. When replayed, the crtc and output ids are mapped (in order of
+ * appearance) onto those of the monitors of the running server, bursts using more ids than
+ * there are monitors are skipped.
+ *
+ * Before timing, it checks that patching the layout with a burst describing the live layout
+ * gives the same monitors as a rebuild.
+ */
+
+// Pull in the layout code, including the static functions.
+int xininfo_main ( int argc, char **argv );
+#define main    xininfo_main
+#include "../source/xininfo.c"
+#undef main
+
+// Exit code for a skipped test.
+#define EXIT_SKIP      77
+#define EVENT_SIZE     32
+
+typedef struct
+{
+    xcb_generic_event_t **events;
+    int                 num_events;
+} Burst;
+
+static int record ( const char *file, int seconds )
+{
+    FILE *fp = fopen ( file, "w" );
+    if ( fp == NULL ) {
+        fprintf ( stderr, "Failed to open %s: %s\n", file, strerror ( errno ) );
+        return EXIT_FAILURE;
+    }
+    uint8_t base = 0;
+    x11_is_extension_present ( &xcb_randr_id, &base );
+    xcb_randr_select_input ( connection, screen->root,
+                             XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE |
+                             XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE |
+                             XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE );
+    xcb_flush ( connection );
+
+    int       num_events = 0;
+    long long end        = monotonic_ms () + seconds * 1000LL;
+    long long remaining;
+    while ( ( remaining = end - monotonic_ms () ) > 0 ) {
+        xcb_generic_event_t *ev;
+        while ( ( ev = xcb_poll_for_event ( connection ) ) != NULL ) {
+            uint8_t type = ev->response_type & ~0x80;
+            if ( type == base + XCB_RANDR_SCREEN_CHANGE_NOTIFY || type == base + XCB_RANDR_NOTIFY ) {
+                ev->response_type = type - base;
+                fwrite ( ev, EVENT_SIZE, 1, fp );
+                num_events++;
+            }
+            free ( ev );
+        }
+        struct pollfd pfd = { .fd = xcb_get_file_descriptor ( connection ), .events = POLLIN };
+        poll ( &pfd, 1, (int) remaining );
+    }
+    fclose ( fp );
+    printf ( "Recorded %d events.\n", num_events );
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Map a recorded id onto the id of the n-th live monitor.
+ */
+static uint32_t map_id ( uint32_t *seen, int *num_seen, uint32_t id, const uint32_t *live, int num_live )
+{
+    int i = 0;
+    if ( id == XCB_NONE ) {
+        return id;
+    }
+    for (; i < *num_seen && seen[i] != id; i++ ) {
+        ;
+    }
+    if ( i == *num_seen ) {
+        seen[( *num_seen )++] = id;
+    }
+    return i < num_live ? live[i] : id;
+}
+
+static void burst_free ( Burst *burst )
+{
+    for ( int i = 0; i < burst->num_events; i++ ) {
+        free ( burst->events[i] );
+    }
+    free ( burst->events );
+}
+
+/**
+ * @returns EXIT_SUCCESS, EXIT_SKIP if the burst needs more monitors than the server has,
+ *          or EXIT_FAILURE.
+ */
+static int burst_load ( Burst *burst, const char *file, MMB_Screen *mmc )
+{
+    FILE *fp = fopen ( file, "r" );
+    if ( fp == NULL ) {
+        fprintf ( stderr, "Failed to open %s: %s\n", file, strerror ( errno ) );
+        return EXIT_FAILURE;
+    }
+    uint32_t crtcs[mmc->num_monitors], outputs[mmc->num_monitors];
+    for ( int i = 0; i < mmc->num_monitors; i++ ) {
+        crtcs[i]   = mmc->monitors[i]->crtc;
+        outputs[i] = mmc->monitors[i]->output;
+    }
+    // A burst never refers to more ids than it has events.
+    uint32_t seen_crtcs[256], seen_outputs[256];
+    int      num_seen_crtcs = 0, num_seen_outputs = 0;
+    uint8_t  buffer[EVENT_SIZE];
+
+    memset ( burst, 0, sizeof ( *burst ) );
+    while ( burst->num_events < 256 && fread ( buffer, EVENT_SIZE, 1, fp ) == 1 ) {
+        // Events in memory carry the full sequence after the 32 wire bytes.
+        xcb_generic_event_t *ev = malloc ( sizeof ( xcb_generic_event_t ) );
+        memset ( ev, 0, sizeof ( xcb_generic_event_t ) );
+        memcpy ( ev, buffer, EVENT_SIZE );
+        if ( ev->response_type == XCB_RANDR_NOTIFY ) {
+            xcb_randr_notify_event_t *ne = (xcb_randr_notify_event_t *) ev;
+            if ( ne->subCode == XCB_RANDR_NOTIFY_CRTC_CHANGE ) {
+                ne->u.cc.crtc = map_id ( seen_crtcs, &num_seen_crtcs, ne->u.cc.crtc, crtcs, mmc->num_monitors );
+            }
+            else if ( ne->subCode == XCB_RANDR_NOTIFY_OUTPUT_CHANGE ) {
+                ne->u.oc.crtc   = map_id ( seen_crtcs, &num_seen_crtcs, ne->u.oc.crtc, crtcs, mmc->num_monitors );
+                ne->u.oc.output = map_id ( seen_outputs, &num_seen_outputs, ne->u.oc.output, outputs, mmc->num_monitors );
+            }
+        }
+        ev->response_type += mmc->randr_event_base;
+        burst->events                      = realloc ( burst->events, ( burst->num_events + 1 ) * sizeof ( xcb_generic_event_t * ) );
+        burst->events[burst->num_events++] = ev;
+    }
+    fclose ( fp );
+    if ( burst->num_events == 0 ) {
+        fprintf ( stderr, "%s: no events.\n", file );
+        return EXIT_FAILURE;
+    }
+    // Unmapped ids would hit unrelated or invalid objects on the server.
+    if ( num_seen_crtcs > mmc->num_monitors || num_seen_outputs > mmc->num_monitors ) {
+        fprintf ( stderr, "%s: needs %d monitors, server has %d, skipping.\n", file,
+                  MAX ( num_seen_crtcs, num_seen_outputs ), mmc->num_monitors );
+        burst_free ( burst );
+        return EXIT_SKIP;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int replay ( const char *file, MMB_Screen *mmc, int iterations )
+{
+    Burst burst;
+    int   retv = burst_load ( &burst, file, mmc );
+    if ( retv != EXIT_SUCCESS ) {
+        return retv;
+    }
+
+    long long start = monotonic_ms ();
+    for ( int i = 0; i < iterations; i++ ) {
+        mmb_screen_apply_events ( mmc, burst.events, burst.num_events );
+    }
+    long long patch = monotonic_ms () - start;
+    start = monotonic_ms ();
+    for ( int i = 0; i < iterations; i++ ) {
+        mmb_screen_rebuild ( mmc );
+    }
+    long long rebuild = monotonic_ms () - start;
+
+    printf ( "%s: %d events, %d monitors\n", file, burst.num_events, mmc->num_monitors );
+    printf ( "    patch:   %8.3f ms/burst\n", patch / (double) iterations );
+    printf ( "    rebuild: %8.3f ms/burst\n", rebuild / (double) iterations );
+    burst_free ( &burst );
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Combine two exit codes: any failure fails, otherwise any skip skips.
+ */
+static int exit_merge ( int a, int b )
+{
+    if ( a == EXIT_FAILURE || b == EXIT_FAILURE ) {
+        return EXIT_FAILURE;
+    }
+    return a == EXIT_SKIP ? a : b;
+}
+
+static xcb_generic_event_t *event_new ( uint8_t response_type )
+{
+    xcb_generic_event_t *ev = malloc ( sizeof ( xcb_generic_event_t ) );
+    memset ( ev, 0, sizeof ( xcb_generic_event_t ) );
+    ev->response_type = response_type;
+    return ev;
+}
+
+/**
+ * Undo the live layout in mmc (drop every other monitor, scramble the others), patch it back
+ * with a burst describing the live layout, and compare with a rebuild.
+ */
+static int check_patch ( MMB_Screen *mmc )
+{
+    // mmc is the rebuild and stays untouched as reference, a copy gets patched.
+    MMB_Screen ref = *mmc;
+    Burst      burst;
+    memset ( &burst, 0, sizeof ( burst ) );
+    burst.events = malloc ( 2 * mmc->num_monitors * sizeof ( xcb_generic_event_t * ) );
+    for ( int i = 0; i < ref.num_monitors; i++ ) {
+        MMB_Rectangle            *w = ref.monitors[i];
+        xcb_randr_notify_event_t *ne;
+        if ( w->crtc != XCB_NONE ) {
+            ne                = (xcb_randr_notify_event_t *) event_new ( mmc->randr_event_base + XCB_RANDR_NOTIFY );
+            ne->subCode       = XCB_RANDR_NOTIFY_CRTC_CHANGE;
+            ne->u.cc.crtc     = w->crtc;
+            // Any mode but none enables the crtc.
+            ne->u.cc.mode     = w->enabled ? 1 : XCB_NONE;
+            ne->u.cc.x        = w->x;
+            ne->u.cc.y        = w->y;
+            ne->u.cc.width    = w->w;
+            ne->u.cc.height   = w->h;
+            burst.events[burst.num_events++] = (xcb_generic_event_t *) ne;
+        }
+        ne                  = (xcb_randr_notify_event_t *) event_new ( mmc->randr_event_base + XCB_RANDR_NOTIFY );
+        ne->subCode         = XCB_RANDR_NOTIFY_OUTPUT_CHANGE;
+        ne->u.oc.output     = w->output;
+        ne->u.oc.crtc       = w->crtc;
+        ne->u.oc.connection = w->connection;
+        burst.events[burst.num_events++] = (xcb_generic_event_t *) ne;
+    }
+
+    // Build the patched copy: even monitors are unknown (docked later), the rest is stale.
+    MMB_Screen patched = ref;
+    patched.monitors     = NULL;
+    patched.num_monitors = 0;
+    for ( int i = 1; i < ref.num_monitors; i += 2 ) {
+        MMB_Rectangle *w = malloc ( sizeof ( MMB_Rectangle ) );
+        *w         = *( ref.monitors[i] );
+        w->name    = strdup ( ref.monitors[i]->name ? ref.monitors[i]->name : "" );
+        if ( w->modes_len > 0 ) {
+            w->modes = malloc ( w->modes_len * sizeof ( MMB_Mode ) );
+            memcpy ( w->modes, ref.monitors[i]->modes, w->modes_len * sizeof ( MMB_Mode ) );
+        }
+        w->x       = w->y = 0;
+        w->w       = w->h = 1;
+        w->primary = !w->primary;
+        patched.monitors                         = realloc ( patched.monitors, ( patched.num_monitors + 1 ) * sizeof ( MMB_Rectangle* ) );
+        patched.monitors[patched.num_monitors++] = w;
+    }
+    mmb_screen_apply_events ( &patched, burst.events, burst.num_events );
+
+    int retv = EXIT_SUCCESS;
+    if ( patched.num_monitors != ref.num_monitors ) {
+        fprintf ( stderr, "check: %d monitors after patching, %d after rebuild\n", patched.num_monitors, ref.num_monitors );
+        retv = EXIT_FAILURE;
+    }
+    for ( int i = 0; retv == EXIT_SUCCESS && i < ref.num_monitors; i++ ) {
+        MMB_Rectangle *a = patched.monitors[i], *b = ref.monitors[i];
+        if ( a->output != b->output || a->enabled != b->enabled || a->primary != b->primary ||
+             a->x != b->x || a->y != b->y || a->w != b->w || a->h != b->h ) {
+            fprintf ( stderr, "check: monitor %d: patched %s %d %d -> %d %d (primary %d), rebuild %s %d %d -> %d %d (primary %d)\n", i,
+                      a->name, a->x, a->y, a->w, a->h, a->primary,
+                      b->name, b->x, b->y, b->w, b->h, b->primary );
+            retv = EXIT_FAILURE;
+        }
+    }
+    printf ( "check: patch %s rebuild (%d monitors)\n", retv == EXIT_SUCCESS ? "matches" : "differs from", ref.num_monitors );
+
+    for ( int i = 0; i < patched.num_monitors; i++ ) {
+        mmb_rectangle_free ( patched.monitors[i] );
+    }
+    free ( patched.monitors );
+    burst_free ( &burst );
+    return retv;
+}
+
+int main ( int argc, char **argv )
+{
+    int iterations = 100;
+    int retv       = EXIT_SUCCESS;
+
+    connection = xcb_connect ( NULL, &screen_nbr );
+    if ( xcb_connection_has_error ( connection ) ) {
+        fprintf ( stderr, "No X server, skipping.\n" );
+        xcb_disconnect ( connection );
+        return EXIT_SKIP;
+    }
+    screen = xcb_aux_get_screen ( connection, screen_nbr );
+
+    if ( argc > 3 && strcmp ( argv[1], "-record" ) == 0 ) {
+        retv = record ( argv[2], atoi ( argv[3] ) );
+        xcb_disconnect ( connection );
+        return retv;
+    }
+
+    MMB_Screen *mmc = malloc ( sizeof ( *mmc ) );
+    memset ( mmc, 0, sizeof ( *mmc ) );
+    mmb_screen_rebuild ( mmc );
+    if ( !mmc->randr || mmc->num_monitors == 0 ) {
+        fprintf ( stderr, "No RandR monitors, skipping.\n" );
+        mmb_screen_free ( &mmc );
+        xcb_disconnect ( connection );
+        return EXIT_SKIP;
+    }
+
+    int ac = 1;
+    if ( argc > 2 && strcmp ( argv[1], "-n" ) == 0 ) {
+        iterations = MAX ( 1, atoi ( argv[2] ) );
+        ac         = 3;
+    }
+    retv = check_patch ( mmc );
+    if ( ac == argc ) {
+        // Run from make check, use the shipped bursts.
+        const char *srcdir = getenv ( "srcdir" );
+        const char *files[] = { "dock.events", "undock.events" };
+        for ( unsigned int i = 0; i < sizeof ( files ) / sizeof ( files[0] ); i++ ) {
+            char *path = NULL;
+            if ( asprintf ( &path, "%s/bench/data/%s", srcdir ? srcdir : ".", files[i] ) >= 0 ) {
+                retv = exit_merge ( retv, replay ( path, mmc, iterations ) );
+                free ( path );
+            }
+        }
+    }
+    for (; ac < argc; ac++ ) {
+        retv = exit_merge ( retv, replay ( argv[ac], mmc, iterations ) );
+    }
+
+    mmb_screen_free ( &mmc );
+    xcb_disconnect ( connection );
+    return retv;
+}
@@ -36,20 +36,30 @@
 #include <err.h>
 #include <math.h>
 #include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <dirent.h>
 #include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 #include <xcb/xcb_aux.h>
 #include <xcb/randr.h>
 #include <xcb/xinerama.h>
 #include <xcb/dpms.h>
 #include <xcb/xcb_ewmh.h>
 #include <xcb/screensaver.h>
+#include <xcb/xinput.h>
 
 #define MAX( a, b )                          ( ( a ) > ( b ) ? ( a ) : ( b ) )
 #define MIN( a, b )                          ( ( a ) < ( b ) ? ( a ) : ( b ) )
 #define INTERSECT( x, y, x1, y1, w1, h1 )    ( ( ( ( x ) >= ( x1 ) ) && ( ( x ) < ( x1 + w1 ) ) ) && ( ( ( y ) >= ( y1 ) ) && ( ( y ) < ( y1 + h1 ) ) ) )
 
-#define TRUE     1
-#define FALSE    0
+#define TRUE            1
+#define FALSE           0
+
+// Exit status when the X server did not reply in time.
+#define EXIT_TIMEOUT    2
 
 xcb_connection_t      *connection = NULL;
 xcb_screen_t          *screen     = NULL;
@@ -72,6 +82,13 @@ typedef struct
     int      primary;
     MMB_Mode *modes;
     int      modes_len;
+    // RandR output/crtc backing this monitor. (XCB_NONE for xinerama)
+    xcb_randr_output_t output;
+    xcb_randr_crtc_t   crtc;
+    int                connection;
+    // Usable area, without panels. (see mmb_screen_get_workarea)
+    int                wa_x, wa_y;
+    int                wa_w, wa_h;
 } MMB_Rectangle;
 
 typedef struct
@@ -86,15 +103,115 @@ typedef struct
 
     // Mouse position
     MMB_Rectangle active_monitor;
+
+    // Layout was build from RandR, and the first RandR event code.
+    int           randr;
+    uint8_t       randr_event_base;
+
+    // Workarea of the monitors is up to date.
+    int           workarea_valid;
 } MMB_Screen;
 
 // find active_monitor pointer location
 void x11_build_monitor_layout ( MMB_Screen *mmc );
+// Patch layout from a burst of RandR events.
+int mmb_screen_apply_events ( MMB_Screen *mmc, xcb_generic_event_t **events, int num_events );
+
+// Deadline (monotonic, in ms) shared by all pending replies, 0 if unbounded.
+static long long reply_deadline = 0;
+// Print the cached layout when the deadline expires.
+static int       timeout_cache = FALSE;
+// Set once the commands run, their output is not mixed with the cached layout.
+static int       commands_started = FALSE;
+
+static long long monotonic_ms ( void )
+{
+    struct timespec ts;
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Get the path of the layout cache, caller must free.
+ */
+static char *layout_cache_path ( void )
+{
+    char       *path = NULL;
+    const char *dir  = getenv ( "XDG_CACHE_HOME" );
+    if ( dir != NULL && dir[0] != '\0' ) {
+        if ( asprintf ( &path, "%s/xininfo.layout", dir ) < 0 ) {
+            return NULL;
+        }
+    }
+    else if ( ( dir = getenv ( "HOME" ) ) != NULL ) {
+        if ( asprintf ( &path, "%s/.cache/xininfo.layout", dir ) < 0 ) {
+            return NULL;
+        }
+    }
+    return path;
+}
+
+/**
+ * Called when the deadline expired, print the cached layout (if requested and no command
+ * printed anything yet) and exit.
+ */
+static void x11_timeout ( void )
+{
+    fprintf ( stderr, "Timeout waiting for the X server.\n" );
+    char *path = ( timeout_cache && !commands_started ) ? layout_cache_path () : NULL;
+    if ( path != NULL ) {
+        FILE *fp = fopen ( path, "r" );
+        if ( fp != NULL ) {
+            char   buffer[1024];
+            size_t len;
+            while ( ( len = fread ( buffer, 1, sizeof ( buffer ), fp ) ) > 0 ) {
+                fwrite ( buffer, 1, len, stdout );
+            }
+            fclose ( fp );
+        }
+        free ( path );
+    }
+    exit ( EXIT_TIMEOUT );
+}
+
+/**
+ * @param sequence The sequence number of the request.
+ * @param e        Error return, or NULL.
+ *
+ * Wait for the reply of a request. If a timeout is set, this drives the socket with poll
+ * until the shared deadline and exits with EXIT_TIMEOUT when it expires.
+ *
+ * @returns the reply, or NULL on error.
+ */
+static void *x11_reply ( unsigned int sequence, xcb_generic_error_t **e )
+{
+    if ( reply_deadline == 0 ) {
+        return xcb_wait_for_reply ( connection, sequence, e );
+    }
+    xcb_flush ( connection );
+    while ( TRUE ) {
+        void *reply = NULL;
+        if ( xcb_poll_for_reply ( connection, sequence, &reply, e ) ) {
+            return reply;
+        }
+        if ( xcb_connection_has_error ( connection ) ) {
+            return NULL;
+        }
+        long long remaining = reply_deadline - monotonic_ms ();
+        if ( remaining <= 0 ) {
+            x11_timeout ();
+        }
+        struct pollfd pfd = { .fd = xcb_get_file_descriptor ( connection ), .events = POLLIN };
+        if ( poll ( &pfd, 1, (int) remaining ) < 0 && errno != EINTR ) {
+            return NULL;
+        }
+    }
+}
 
 static int pointer_get ( MMB_Screen *screen, xcb_window_t root )
 {
     xcb_query_pointer_cookie_t c  = xcb_query_pointer ( connection, root );
-    xcb_query_pointer_reply_t  *r = xcb_query_pointer_reply ( connection, c, NULL );
+    xcb_query_pointer_reply_t  *r = x11_reply ( c.sequence, NULL );
     if ( r ) {
         screen->active_monitor.x = r->root_x;
         screen->active_monitor.y = r->root_y;
@@ -109,10 +226,16 @@ static int mmb_screen_get_current_desktop ( MMB_Screen *screen )
     unsigned int              current_desktop = 0;
     xcb_get_property_cookie_t gcdc;
     gcdc = xcb_ewmh_get_current_desktop ( &ewmh, screen_nbr );
-    if  ( xcb_ewmh_get_current_desktop_reply ( &ewmh, gcdc, &current_desktop, NULL ) ) {
-        xcb_get_property_cookie_t             c = xcb_ewmh_get_desktop_viewport ( &ewmh, screen_nbr );
+    xcb_get_property_cookie_t c  = xcb_ewmh_get_desktop_viewport ( &ewmh, screen_nbr );
+    xcb_get_property_reply_t  *r = x11_reply ( gcdc.sequence, NULL );
+    int                       found;
+    found = ( r && xcb_ewmh_get_current_desktop_from_reply ( &current_desktop, r ) );
+    free ( r );
+    r = x11_reply ( c.sequence, NULL );
+    if ( found ) {
         xcb_ewmh_get_desktop_viewport_reply_t vp;
-        if ( xcb_ewmh_get_desktop_viewport_reply ( &ewmh, c, &vp, NULL ) ) {
+        // On success the reply is owned by vp.
+        if ( r && xcb_ewmh_get_desktop_viewport_from_reply ( &vp, r ) ) {
             if ( current_desktop < vp.desktop_viewport_len ) {
                 screen->active_monitor.x = vp.desktop_viewport[current_desktop].x;
                 screen->active_monitor.y = vp.desktop_viewport[current_desktop].y;
@@ -120,8 +243,10 @@ static int mmb_screen_get_current_desktop ( MMB_Screen *screen )
                 return TRUE;
             }
             xcb_ewmh_get_desktop_viewport_reply_wipe ( &vp );
+            return FALSE;
         }
     }
+    free ( r );
     return FALSE;
 }
 
@@ -153,33 +278,28 @@ static MMB_Screen *mmb_screen_create ( int screen_nbr )
     return retv;
 }
 /**
- * Create monitor based on output id
+ * Create monitor from output (and optional crtc) info reply.
  */
-static MMB_Rectangle * x11_get_monitor_from_output ( xcb_randr_output_t out, xcb_randr_mode_info_t *modes, int modes_len )
+static MMB_Rectangle * x11_monitor_from_output_reply ( xcb_randr_output_t out,
+                                                       xcb_randr_get_output_info_reply_t *op_reply,
+                                                       xcb_randr_get_crtc_info_reply_t *crtc_reply,
+                                                       xcb_randr_mode_info_t *modes, int modes_len )
 {
-    xcb_randr_get_output_info_reply_t  *op_reply;
-    xcb_randr_get_crtc_info_reply_t    *crtc_reply;
-    xcb_randr_get_output_info_cookie_t it = xcb_randr_get_output_info ( connection, out, XCB_CURRENT_TIME );
-    op_reply = xcb_randr_get_output_info_reply ( connection, it, NULL );
-
     if ( op_reply->num_modes == 0 ) {
         // No monitor attached.
-        free ( op_reply );
         return NULL;
     }
     MMB_Rectangle *retv = malloc ( sizeof ( MMB_Rectangle ) );
     memset ( retv, '\0', sizeof ( MMB_Rectangle ) );
-    if ( op_reply->crtc != XCB_NONE ) {
-        xcb_randr_get_crtc_info_cookie_t ct = xcb_randr_get_crtc_info ( connection, op_reply->crtc, XCB_CURRENT_TIME );
-        crtc_reply = xcb_randr_get_crtc_info_reply ( connection, ct, NULL );
-        if ( crtc_reply ) {
-            retv->enabled = TRUE;
-            retv->x       = crtc_reply->x;
-            retv->y       = crtc_reply->y;
-            retv->w       = crtc_reply->width;
-            retv->h       = crtc_reply->height;
-            free ( crtc_reply );
-        }
+    retv->output     = out;
+    retv->crtc       = op_reply->crtc;
+    retv->connection = op_reply->connection;
+    if ( crtc_reply ) {
+        retv->enabled = TRUE;
+        retv->x       = crtc_reply->x;
+        retv->y       = crtc_reply->y;
+        retv->w       = crtc_reply->width;
+        retv->h       = crtc_reply->height;
     }
 
     retv->modes_len = op_reply->num_modes;
@@ -201,6 +321,27 @@ static MMB_Rectangle * x11_get_monitor_from_output ( xcb_randr_output_t out, xcb
     retv->name = malloc ( ( tname_len + 1 ) * sizeof ( char ) );
     memcpy ( retv->name, tname, tname_len );
     retv->name[tname_len] = '\0';
+    return retv;
+}
+/**
+ * Create monitor based on output id
+ */
+static MMB_Rectangle * x11_get_monitor_from_output ( xcb_randr_output_t out, xcb_randr_mode_info_t *modes, int modes_len )
+{
+    xcb_randr_get_output_info_reply_t  *op_reply;
+    xcb_randr_get_crtc_info_reply_t    *crtc_reply = NULL;
+    xcb_randr_get_output_info_cookie_t it          = xcb_randr_get_output_info ( connection, out, XCB_CURRENT_TIME );
+    op_reply = x11_reply ( it.sequence, NULL );
+    if ( op_reply == NULL ) {
+        return NULL;
+    }
+
+    if ( op_reply->num_modes > 0 && op_reply->crtc != XCB_NONE ) {
+        xcb_randr_get_crtc_info_cookie_t ct = xcb_randr_get_crtc_info ( connection, op_reply->crtc, XCB_CURRENT_TIME );
+        crtc_reply = x11_reply ( ct.sequence, NULL );
+    }
+    MMB_Rectangle *retv = x11_monitor_from_output_reply ( out, op_reply, crtc_reply, modes, modes_len );
+    free ( crtc_reply );
     free ( op_reply );
     return retv;
 }
@@ -209,10 +350,10 @@ static void x11_build_monitor_layout_xinerama ( MMB_Screen *mmc )
 {
     xcb_xinerama_query_screens_cookie_t screens_cookie = xcb_xinerama_query_screens_unchecked ( connection );
 
-    xcb_xinerama_query_screens_reply_t  *screens_reply = xcb_xinerama_query_screens_reply ( connection,
-                                                                                            screens_cookie,
-                                                                                            NULL
-                                                                                            );
+    xcb_xinerama_query_screens_reply_t  *screens_reply = x11_reply ( screens_cookie.sequence, NULL );
+    if ( screens_reply == NULL ) {
+        return;
+    }
 
     xcb_xinerama_screen_info_iterator_t screens_iterator = xcb_xinerama_query_screens_screen_info_iterator (
         screens_reply
@@ -232,32 +373,45 @@ static void x11_build_monitor_layout_xinerama ( MMB_Screen *mmc )
 
     free ( screens_reply );
 }
-static int x11_is_extension_present ( const char *extension )
+/**
+ * @param extension   The extension.
+ * @param first_event If not NULL, set to the first event code of the extension.
+ *
+ * Uses the libxcb extension cache, main prefetches all extensions so this does not block
+ * outside the deadline.
+ *
+ * @returns TRUE if the extension is present.
+ */
+static int x11_is_extension_present ( xcb_extension_t *extension, uint8_t *first_event )
 {
-    xcb_query_extension_cookie_t randr_cookie = xcb_query_extension ( connection, strlen ( extension ), extension );
-    xcb_query_extension_reply_t  *randr_reply = xcb_query_extension_reply ( connection, randr_cookie, NULL );
-    int                          present      = randr_reply->present;
-    free ( randr_reply );
-    return present;
+    const xcb_query_extension_reply_t *reply = xcb_get_extension_data ( connection, extension );
+    if ( reply == NULL || !reply->present ) {
+        return FALSE;
+    }
+    if ( first_event != NULL ) {
+        *first_event = reply->first_event;
+    }
+    return TRUE;
 }
 
 void x11_build_monitor_layout ( MMB_Screen *mmc )
 {
     // If RANDR is not available, try Xinerama
-    if ( !x11_is_extension_present ( "RANDR" ) ) {
+    if ( !x11_is_extension_present ( &xcb_randr_id, &( mmc->randr_event_base ) ) ) {
         // Check if xinerama is available.
-        if ( x11_is_extension_present ( "XINERAMA" ) ) {
+        if ( x11_is_extension_present ( &xcb_xinerama_id, NULL ) ) {
             x11_build_monitor_layout_xinerama ( mmc );
             return;
         }
         fprintf ( stderr, "No RANDR or Xinerama available for getting monitor layout." );
         return;
     }
+    mmc->randr = TRUE;
 
     xcb_randr_get_screen_resources_current_reply_t  *res_reply;
     xcb_randr_get_screen_resources_current_cookie_t src;
     src       = xcb_randr_get_screen_resources_current ( connection, screen->root );
-    res_reply = xcb_randr_get_screen_resources_current_reply ( connection, src, NULL );
+    res_reply = x11_reply ( src.sequence, NULL );
     if ( !res_reply ) {
         return;  //just report error
     }
@@ -268,7 +422,7 @@ void x11_build_monitor_layout ( MMB_Screen *mmc )
 
     // Get primary.
     xcb_randr_get_output_primary_cookie_t pc      = xcb_randr_get_output_primary ( connection, screen->root );
-    xcb_randr_get_output_primary_reply_t  *pc_rep = xcb_randr_get_output_primary_reply ( connection, pc, NULL );
+    xcb_randr_get_output_primary_reply_t  *pc_rep = x11_reply ( pc.sequence, NULL );
 
     for ( int i = mon_num - 1; i >= 0; i-- ) {
         MMB_Rectangle *w = x11_get_monitor_from_output ( ops[i], modes, modes_len );
@@ -288,6 +442,187 @@ void x11_build_monitor_layout ( MMB_Screen *mmc )
     free ( res_reply );
 }
 
+static void mmb_rectangle_free ( MMB_Rectangle *rect )
+{
+    if ( rect->name ) {
+        free ( rect->name );
+    }
+    if ( rect->modes_len > 0 ) {
+        free ( rect->modes );
+    }
+    free ( rect );
+}
+
+// Sysfs directory with the DRM connectors.
+static const char *drm_root = "/sys/class/drm";
+// Use the DRM backend instead of an X server.
+static int        use_drm = FALSE;
+
+static int drm_connector_filter ( const struct dirent *d )
+{
+    // Connectors are named card<N>-<connector>.
+    return strncmp ( d->d_name, "card", 4 ) == 0 && strchr ( d->d_name, '-' ) != NULL;
+}
+
+/**
+ * @param connector Name of the connector directory.
+ * @param file      Name of the attribute.
+ * @param length    Set to the number of bytes read, or NULL.
+ *
+ * Read a sysfs attribute of a connector.
+ *
+ * @returns the (zero terminated) content, or NULL. Caller must free.
+ */
+static char *drm_read_file ( const char *connector, const char *file, size_t *length )
+{
+    char *path = NULL;
+    if ( asprintf ( &path, "%s/%s/%s", drm_root, connector, file ) < 0 ) {
+        return NULL;
+    }
+    int fd = open ( path, O_RDONLY );
+    free ( path );
+    if ( fd < 0 ) {
+        return NULL;
+    }
+    size_t  size = 256, len = 0;
+    char    *buf = malloc ( size + 1 );
+    ssize_t r;
+    while ( ( r = read ( fd, buf + len, size - len ) ) != 0 ) {
+        if ( r < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            // Do not mistake a failed read for an empty attribute.
+            free ( buf );
+            close ( fd );
+            return NULL;
+        }
+        len += r;
+        if ( len == size ) {
+            size *= 2;
+            buf   = realloc ( buf, size + 1 );
+        }
+    }
+    close ( fd );
+    buf[len] = '\0';
+    if ( length != NULL ) {
+        *length = len;
+    }
+    return buf;
+}
+
+/**
+ * Create monitor from a DRM connector, NULL if nothing is connected.
+ * Sysfs does not expose the position or current mode, so the preferred (first) mode is used
+ * as size, and only the preferred mode gets a refresh rate (from the EDID).
+ */
+static MMB_Rectangle *drm_get_monitor ( const char *connector )
+{
+    char *status = drm_read_file ( connector, "status", NULL );
+    if ( status == NULL || strncmp ( status, "connected", 9 ) != 0 ) {
+        free ( status );
+        return NULL;
+    }
+    free ( status );
+
+    // First detailed timing descriptor of the EDID holds the preferred mode, sysfs only
+    // gives the refresh rate for that one.
+    int           pref_w   = 0, pref_h = 0, pref_interlaced = FALSE;
+    double        pref_rate = 0.0;
+    size_t        edid_len  = 0;
+    unsigned char *edid     = (unsigned char *) drm_read_file ( connector, "edid", &edid_len );
+    if ( edid != NULL && edid_len >= 128 ) {
+        const unsigned char *dt    = &edid[54];
+        double              clock  = ( dt[0] | ( dt[1] << 8 ) ) * 10000.0;
+        int                 hact   = dt[2] | ( ( dt[4] & 0xF0 ) << 4 );
+        int                 hblank = dt[3] | ( ( dt[4] & 0x0F ) << 8 );
+        int                 vact   = dt[5] | ( ( dt[7] & 0xF0 ) << 4 );
+        int                 vblank = dt[6] | ( ( dt[7] & 0x0F ) << 8 );
+        if ( clock > 0 && ( hact + hblank ) > 0 && ( vact + vblank ) > 0 ) {
+            // Interlaced timings describe one field, the rate is the field rate.
+            pref_interlaced = ( dt[17] & 0x80 ) != 0;
+            pref_w          = hact;
+            pref_h          = pref_interlaced ? vact * 2 : vact;
+            pref_rate       = clock / (double) ( ( hact + hblank ) * ( vact + vblank ) );
+        }
+    }
+    free ( edid );
+
+    char *modes = drm_read_file ( connector, "modes", NULL );
+    if ( modes == NULL ) {
+        return NULL;
+    }
+    MMB_Rectangle *retv = malloc ( sizeof ( MMB_Rectangle ) );
+    memset ( retv, '\0', sizeof ( MMB_Rectangle ) );
+    for ( char *line = strtok ( modes, "\n" ); line != NULL; line = strtok ( NULL, "\n" ) ) {
+        int  w, h;
+        char flag = '\0';
+        if ( sscanf ( line, "%dx%d%c", &w, &h, &flag ) >= 2 ) {
+            retv->modes = realloc ( retv->modes, ( retv->modes_len + 1 ) * sizeof ( MMB_Mode ) );
+            retv->modes[retv->modes_len].w    = w;
+            retv->modes[retv->modes_len].h    = h;
+            retv->modes[retv->modes_len].rate = 0.0;
+            // Modes are listed as WxH, or WxHi when interlaced.
+            if ( pref_rate > 0 && w == pref_w && h == pref_h && ( flag == 'i' ) == pref_interlaced ) {
+                retv->modes[retv->modes_len].rate = pref_rate;
+                pref_rate                         = 0.0;
+            }
+            retv->modes_len++;
+        }
+    }
+    free ( modes );
+    if ( retv->modes_len == 0 ) {
+        // No monitor attached.
+        free ( retv->modes );
+        free ( retv );
+        return NULL;
+    }
+    retv->connection = XCB_RANDR_CONNECTION_CONNECTED;
+    retv->name       = strdup ( strchr ( connector, '-' ) + 1 );
+
+    char *enabled = drm_read_file ( connector, "enabled", NULL );
+    if ( enabled != NULL && strncmp ( enabled, "enabled", 7 ) == 0 ) {
+        retv->enabled = TRUE;
+        retv->w       = retv->modes[0].w;
+        retv->h       = retv->modes[0].h;
+    }
+    free ( enabled );
+    return retv;
+}
+
+/**
+ * Create MMB_Screen from the DRM connectors in sysfs, without an X server.
+ *
+ * @returns filled in MMB_Screen
+ */
+static MMB_Screen *mmb_screen_create_drm ( void )
+{
+    // Create empty structure.
+    MMB_Screen *retv = malloc ( sizeof ( *retv ) );
+    memset ( retv, 0, sizeof ( *retv ) );
+
+    struct dirent **entries = NULL;
+    int           n         = scandir ( drm_root, &entries, drm_connector_filter, alphasort );
+    if ( n < 0 ) {
+        fprintf ( stderr, "Failed to read %s: %s\n", drm_root, strerror ( errno ) );
+        return retv;
+    }
+    for ( int i = 0; i < n; i++ ) {
+        MMB_Rectangle *w = drm_get_monitor ( entries[i]->d_name );
+        if ( w ) {
+            retv->monitors                     = realloc ( retv->monitors, ( retv->num_monitors + 1 ) * sizeof ( MMB_Rectangle* ) );
+            retv->monitors[retv->num_monitors] = w;
+            retv->num_monitors++;
+            // Positions are unknown, all monitors are at 0,0.
+            retv->base.w = MAX ( retv->base.w, w->w );
+            retv->base.h = MAX ( retv->base.h, w->h );
+        }
+        free ( entries[i] );
+    }
+    free ( entries );
+    return retv;
+}
+
 /**
  * @param screen a Pointer to the MMB_Screen pointer to free.
  *
@@ -304,13 +639,7 @@ static void mmb_screen_free ( MMB_Screen **screen )
     }
 
     for ( int i = 0; i < ( *screen )->num_monitors; i++ ) {
-        if ( ( *screen )->monitors[i]->name ) {
-            free ( ( *screen )->monitors[i]->name );
-            if ( ( *screen )->monitors[i]->modes_len > 0 ) {
-                free (  ( *screen )->monitors[i]->modes );
-            }
-            free ( ( *screen )->monitors[i] );
-        }
+        mmb_rectangle_free ( ( *screen )->monitors[i] );
     }
 
     if ( ( *screen )->monitors != NULL ) {
@@ -321,10 +650,454 @@ static void mmb_screen_free ( MMB_Screen **screen )
     screen = NULL;
 }
 
-static int mmb_screen_get_active_monitor ( MMB_Screen *screen )
+/**
+ * @param mmc The MMB_Screen to rebuild.
+ *
+ * Throw away all monitors and query the layout from scratch.
+ */
+static void mmb_screen_rebuild ( MMB_Screen *mmc )
+{
+    // The size in the connection setup is stale, ask the root window.
+    xcb_get_geometry_cookie_t gc = xcb_get_geometry ( connection, screen->root );
+    for ( int i = 0; i < mmc->num_monitors; i++ ) {
+        mmb_rectangle_free ( mmc->monitors[i] );
+    }
+    free ( mmc->monitors );
+    mmc->monitors     = NULL;
+    mmc->num_monitors = 0;
+    x11_build_monitor_layout ( mmc );
+    xcb_get_geometry_reply_t *gr = x11_reply ( gc.sequence, NULL );
+    if ( gr ) {
+        mmc->base.w = gr->width;
+        mmc->base.h = gr->height;
+        free ( gr );
+    }
+}
+
+static int mmb_screen_find_output ( MMB_Screen *mmc, xcb_randr_output_t output )
 {
+    for ( int i = 0; i < mmc->num_monitors; i++ ) {
+        if ( mmc->monitors[i]->output == output ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int x11_output_index ( const xcb_randr_output_t *ops, int ops_len, xcb_randr_output_t output )
+{
+    for ( int i = 0; i < ops_len; i++ ) {
+        if ( ops[i] == output ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @param mmc     The MMB_Screen.
+ * @param ops     The outputs of the screen resources.
+ * @param ops_len Number of outputs.
+ * @param output  The output to add.
+ *
+ * x11_build_monitor_layout adds the monitors in reverse order of the screen resources.
+ *
+ * @returns the index a new monitor for output should get, the end if output is unknown.
+ */
+static int mmb_screen_output_position ( MMB_Screen *mmc, const xcb_randr_output_t *ops, int ops_len, xcb_randr_output_t output )
+{
+    int index = x11_output_index ( ops, ops_len, output );
+    int pos   = 0;
+    if ( index < 0 ) {
+        return mmc->num_monitors;
+    }
+    for (; pos < mmc->num_monitors && x11_output_index ( ops, ops_len, mmc->monitors[pos]->output ) > index; pos++ ) {
+        ;
+    }
+    return pos;
+}
+
+// Pending change of one output, coalesced over a burst of events.
+typedef struct
+{
+    xcb_randr_output_t output;
+    xcb_randr_crtc_t   crtc;
+    int                connection;
+    int                requery;
+} MMB_OutputChange;
+
+// Last known geometry of one crtc, coalesced over a burst of events.
+typedef struct
+{
+    xcb_randr_crtc_t crtc;
+    int              enabled;
+    int              x, y;
+    int              w, h;
+} MMB_CrtcChange;
+
+/**
+ * @param mmc        The MMB_Screen to update.
+ * @param events     The RandR events received since the last update.
+ * @param num_events Number of events.
+ *
+ * Coalesce a burst of RandR change events and patch only the affected monitors.
+ * Crtc geometry is taken from the events, only outputs whose connection changed (or that
+ * are new) are queried again, pipelined. A resource change (new mode list) or a layout
+ * not build from RandR falls back to a full rebuild.
+ * The caller is responsible for selecting the RandR events on the root window.
+ *
+ * @returns the number of monitors patched, or -1 when the layout was rebuild.
+ */
+int mmb_screen_apply_events ( MMB_Screen *mmc, xcb_generic_event_t **events, int num_events )
+{
+    MMB_OutputChange *ochanges     = NULL;
+    int              num_ochanges  = 0;
+    MMB_CrtcChange   *cchanges     = NULL;
+    int              num_cchanges  = 0;
+    int              rebuild       = !mmc->randr;
+    int              num_requery   = 0;
+    int              patched       = 0;
+
+    for ( int e = 0; e < num_events && !rebuild; e++ ) {
+        uint8_t type = events[e]->response_type & ~0x80;
+        if ( type == mmc->randr_event_base + XCB_RANDR_SCREEN_CHANGE_NOTIFY ) {
+            xcb_randr_screen_change_notify_event_t *sc = (xcb_randr_screen_change_notify_event_t *) events[e];
+            // The server swaps width and height when the screen is rotated.
+            if ( sc->rotation & ( XCB_RANDR_ROTATION_ROTATE_90 | XCB_RANDR_ROTATION_ROTATE_270 ) ) {
+                mmc->base.w = sc->height;
+                mmc->base.h = sc->width;
+            }
+            else {
+                mmc->base.w = sc->width;
+                mmc->base.h = sc->height;
+            }
+        }
+        else if ( type == mmc->randr_event_base + XCB_RANDR_NOTIFY ) {
+            xcb_randr_notify_event_t *ne = (xcb_randr_notify_event_t *) events[e];
+            if ( ne->subCode == XCB_RANDR_NOTIFY_CRTC_CHANGE ) {
+                xcb_randr_crtc_change_t *cc = &( ne->u.cc );
+                int                     i   = 0;
+                for (; i < num_cchanges && cchanges[i].crtc != cc->crtc; i++ ) {
+                    ;
+                }
+                if ( i == num_cchanges ) {
+                    cchanges = realloc ( cchanges, ( num_cchanges + 1 ) * sizeof ( MMB_CrtcChange ) );
+                    num_cchanges++;
+                }
+                cchanges[i].crtc    = cc->crtc;
+                cchanges[i].enabled = cc->mode != XCB_NONE;
+                cchanges[i].x       = cc->x;
+                cchanges[i].y       = cc->y;
+                cchanges[i].w       = cc->width;
+                cchanges[i].h       = cc->height;
+            }
+            else if ( ne->subCode == XCB_RANDR_NOTIFY_OUTPUT_CHANGE ) {
+                xcb_randr_output_change_t *oc = &( ne->u.oc );
+                int                       i   = 0;
+                for (; i < num_ochanges && ochanges[i].output != oc->output; i++ ) {
+                    ;
+                }
+                if ( i == num_ochanges ) {
+                    int m = mmb_screen_find_output ( mmc, oc->output );
+                    ochanges = realloc ( ochanges, ( num_ochanges + 1 ) * sizeof ( MMB_OutputChange ) );
+                    ochanges[i].output = oc->output;
+                    // Unknown outputs have no mode list yet.
+                    ochanges[i].requery    = ( m < 0 );
+                    ochanges[i].connection = ( m < 0 ) ? XCB_RANDR_CONNECTION_DISCONNECTED : mmc->monitors[m]->connection;
+                    num_ochanges++;
+                }
+                // A replug can bring a different monitor with a different mode list.
+                if ( ochanges[i].connection != oc->connection ) {
+                    ochanges[i].requery = TRUE;
+                }
+                ochanges[i].connection = oc->connection;
+                ochanges[i].crtc       = oc->crtc;
+            }
+            else if ( ne->subCode == XCB_RANDR_NOTIFY_RESOURCE_CHANGE ) {
+                rebuild = TRUE;
+            }
+        }
+    }
+
+    mmc->workarea_valid = FALSE;
+    if ( rebuild ) {
+        free ( ochanges );
+        free ( cchanges );
+        mmb_screen_rebuild ( mmc );
+        return -1;
+    }
+    // The primary output can change in the same burst, collected at the end.
+    xcb_randr_get_output_primary_cookie_t pc = xcb_randr_get_output_primary ( connection, screen->root );
+
+    // Move outputs to their new crtc, query them if the geometry of that crtc is not known.
+    for ( int i = 0; i < num_ochanges; i++ ) {
+        int m = mmb_screen_find_output ( mmc, ochanges[i].output );
+        if ( ochanges[i].requery || m < 0 ) {
+            ochanges[i].requery = TRUE;
+            num_requery++;
+            continue;
+        }
+        MMB_Rectangle *w = mmc->monitors[m];
+        if ( w->crtc == ochanges[i].crtc ) {
+            continue;
+        }
+        w->crtc = ochanges[i].crtc;
+        if ( w->crtc == XCB_NONE ) {
+            w->enabled = FALSE;
+            w->x       = w->y = w->w = w->h = 0;
+            patched++;
+            continue;
+        }
+        int c = 0;
+        for (; c < num_cchanges && cchanges[c].crtc != w->crtc; c++ ) {
+            ;
+        }
+        if ( c == num_cchanges ) {
+            ochanges[i].requery = TRUE;
+            num_requery++;
+        }
+    }
+
+    // Patch geometry of monitors driven by a changed crtc.
+    for ( int c = 0; c < num_cchanges; c++ ) {
+        for ( int m = 0; m < mmc->num_monitors; m++ ) {
+            MMB_Rectangle *w = mmc->monitors[m];
+            if ( w->crtc != cchanges[c].crtc || cchanges[c].crtc == XCB_NONE ) {
+                continue;
+            }
+            w->enabled = cchanges[c].enabled;
+            w->x       = cchanges[c].enabled ? cchanges[c].x : 0;
+            w->y       = cchanges[c].enabled ? cchanges[c].y : 0;
+            w->w       = cchanges[c].enabled ? cchanges[c].w : 0;
+            w->h       = cchanges[c].enabled ? cchanges[c].h : 0;
+            patched++;
+        }
+    }
+
+    if ( num_requery > 0 ) {
+        xcb_randr_get_screen_resources_current_cookie_t src  = xcb_randr_get_screen_resources_current ( connection, screen->root );
+        xcb_randr_get_output_info_cookie_t              *oic = malloc ( num_ochanges * sizeof ( xcb_randr_get_output_info_cookie_t ) );
+        xcb_randr_get_output_info_reply_t               **oir = calloc ( num_ochanges, sizeof ( xcb_randr_get_output_info_reply_t * ) );
+        xcb_randr_get_crtc_info_cookie_t                *cic = malloc ( num_ochanges * sizeof ( xcb_randr_get_crtc_info_cookie_t ) );
+
+        // Send all output requests before waiting on any reply.
+        for ( int i = 0; i < num_ochanges; i++ ) {
+            if ( ochanges[i].requery ) {
+                oic[i] = xcb_randr_get_output_info ( connection, ochanges[i].output, XCB_CURRENT_TIME );
+            }
+        }
+        xcb_randr_get_screen_resources_current_reply_t *res_reply = x11_reply ( src.sequence, NULL );
+        for ( int i = 0; i < num_ochanges; i++ ) {
+            if ( ochanges[i].requery ) {
+                oir[i] = x11_reply ( oic[i].sequence, NULL );
+                if ( oir[i] && oir[i]->num_modes > 0 && oir[i]->crtc != XCB_NONE ) {
+                    cic[i] = xcb_randr_get_crtc_info ( connection, oir[i]->crtc, XCB_CURRENT_TIME );
+                }
+            }
+        }
+        xcb_randr_mode_info_t *modes     = res_reply ? xcb_randr_get_screen_resources_current_modes ( res_reply ) : NULL;
+        int                   modes_len  = res_reply ? xcb_randr_get_screen_resources_current_modes_length ( res_reply ) : 0;
+        xcb_randr_output_t    *ops       = res_reply ? xcb_randr_get_screen_resources_current_outputs ( res_reply ) : NULL;
+        int                   ops_len    = res_reply ? xcb_randr_get_screen_resources_current_outputs_length ( res_reply ) : 0;
+        for ( int i = 0; i < num_ochanges; i++ ) {
+            if ( oir[i] == NULL ) {
+                continue;
+            }
+            xcb_randr_get_crtc_info_reply_t *crtc_reply = NULL;
+            if ( oir[i]->num_modes > 0 && oir[i]->crtc != XCB_NONE ) {
+                crtc_reply = x11_reply ( cic[i].sequence, NULL );
+            }
+            MMB_Rectangle *w = x11_monitor_from_output_reply ( ochanges[i].output, oir[i], crtc_reply, modes, modes_len );
+            int           m  = mmb_screen_find_output ( mmc, ochanges[i].output );
+            if ( m >= 0 && w ) {
+                mmb_rectangle_free ( mmc->monitors[m] );
+                mmc->monitors[m] = w;
+            }
+            else if ( m >= 0 ) {
+                // Monitor is gone.
+                mmb_rectangle_free ( mmc->monitors[m] );
+                memmove ( &( mmc->monitors[m] ), &( mmc->monitors[m + 1] ), ( mmc->num_monitors - m - 1 ) * sizeof ( MMB_Rectangle* ) );
+                mmc->num_monitors--;
+            }
+            else if ( w ) {
+                // Insert where x11_build_monitor_layout would put it, so monitor ids match a fresh run.
+                int index = mmb_screen_output_position ( mmc, ops, ops_len, w->output );
+                mmc->monitors = realloc ( mmc->monitors, ( mmc->num_monitors + 1 ) * sizeof ( MMB_Rectangle* ) );
+                memmove ( &( mmc->monitors[index + 1] ), &( mmc->monitors[index] ), ( mmc->num_monitors - index ) * sizeof ( MMB_Rectangle* ) );
+                mmc->monitors[index] = w;
+                mmc->num_monitors++;
+            }
+            if ( m >= 0 || w ) {
+                patched++;
+            }
+            free ( crtc_reply );
+            free ( oir[i] );
+        }
+        free ( res_reply );
+        free ( cic );
+        free ( oir );
+        free ( oic );
+    }
+
+    xcb_randr_get_output_primary_reply_t *pc_rep = x11_reply ( pc.sequence, NULL );
+    for ( int m = 0; m < mmc->num_monitors; m++ ) {
+        mmc->monitors[m]->primary = ( pc_rep && pc_rep->output == mmc->monitors[m]->output );
+    }
+    free ( pc_rep );
+
+    free ( ochanges );
+    free ( cchanges );
+    return patched;
+}
+
+/**
+ * @param clients Filled in with the managed windows, free with xcb_ewmh_get_windows_reply_wipe.
+ *
+ * @returns TRUE if the window manager provides _NET_CLIENT_LIST.
+ */
+static int x11_get_client_list ( xcb_ewmh_get_windows_reply_t *clients )
+{
+    xcb_get_property_cookie_t c  = xcb_ewmh_get_client_list ( &ewmh, screen_nbr );
+    xcb_get_property_reply_t  *r = x11_reply ( c.sequence, NULL );
+    // On success the reply is owned by clients.
+    if ( r == NULL || !xcb_ewmh_get_windows_from_reply ( clients, r ) ) {
+        free ( r );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * @param mmc The MMB_Screen.
+ * @param st  The struts of one window, in root window coordinates.
+ *
+ * Shrink the workarea of all monitors touched by the struts.
+ */
+static void mmb_screen_apply_strut ( MMB_Screen *mmc, const xcb_ewmh_wm_strut_partial_t *st )
+{
+    for ( int i = 0; i < mmc->num_monitors; i++ ) {
+        MMB_Rectangle *m     = mmc->monitors[i];
+        int           x1     = m->wa_x, y1 = m->wa_y;
+        int           x2     = m->wa_x + m->wa_w, y2 = m->wa_y + m->wa_h;
+        int           mon_x2 = m->x + m->w, mon_y2 = m->y + m->h;
+        if ( st->left > 0 && (int) st->left > m->x && (int) st->left_start_y < mon_y2 && (int) st->left_end_y >= m->y ) {
+            x1 = MAX ( x1, (int) st->left );
+        }
+        if ( st->right > 0 && mmc->base.w - (int) st->right < mon_x2 && (int) st->right_start_y < mon_y2 && (int) st->right_end_y >= m->y ) {
+            x2 = MIN ( x2, mmc->base.w - (int) st->right );
+        }
+        if ( st->top > 0 && (int) st->top > m->y && (int) st->top_start_x < mon_x2 && (int) st->top_end_x >= m->x ) {
+            y1 = MAX ( y1, (int) st->top );
+        }
+        if ( st->bottom > 0 && mmc->base.h - (int) st->bottom < mon_y2 && (int) st->bottom_start_x < mon_x2 && (int) st->bottom_end_x >= m->x ) {
+            y2 = MIN ( y2, mmc->base.h - (int) st->bottom );
+        }
+        // A strut can cover the whole monitor, keep the (empty) workarea on the monitor.
+        x1      = MIN ( x1, mon_x2 );
+        y1      = MIN ( y1, mon_y2 );
+        x2      = MAX ( x2, m->x );
+        y2      = MAX ( y2, m->y );
+        m->wa_x = x1;
+        m->wa_y = y1;
+        m->wa_w = MAX ( 0, x2 - x1 );
+        m->wa_h = MAX ( 0, y2 - y1 );
+    }
+}
+
+/**
+ * @param mmc The MMB_Screen to update.
+ *
+ * Compute the usable area of each monitor, by subtracting the struts of all managed windows.
+ * The struts of all clients are requested in one pipelined batch.
+ */
+static void mmb_screen_get_workarea ( MMB_Screen *mmc )
+{
+    if ( mmc->workarea_valid ) {
+        return;
+    }
+    for ( int i = 0; i < mmc->num_monitors; i++ ) {
+        mmc->monitors[i]->wa_x = mmc->monitors[i]->x;
+        mmc->monitors[i]->wa_y = mmc->monitors[i]->y;
+        mmc->monitors[i]->wa_w = mmc->monitors[i]->w;
+        mmc->monitors[i]->wa_h = mmc->monitors[i]->h;
+    }
+    mmc->workarea_valid = TRUE;
+    if ( use_drm ) {
+        return;
+    }
+
+    xcb_ewmh_get_windows_reply_t clients;
+    if ( !x11_get_client_list ( &clients ) ) {
+        return;
+    }
+
+    // Send all requests before waiting on any reply.
+    xcb_get_property_cookie_t *pc = malloc ( clients.windows_len * sizeof ( xcb_get_property_cookie_t ) );
+    xcb_get_property_cookie_t *sc = malloc ( clients.windows_len * sizeof ( xcb_get_property_cookie_t ) );
+    for ( unsigned int i = 0; i < clients.windows_len; i++ ) {
+        pc[i] = xcb_ewmh_get_wm_strut_partial ( &ewmh, clients.windows[i] );
+        sc[i] = xcb_ewmh_get_wm_strut ( &ewmh, clients.windows[i] );
+    }
+    for ( unsigned int i = 0; i < clients.windows_len; i++ ) {
+        xcb_ewmh_wm_strut_partial_t  st;
+        xcb_ewmh_get_extents_reply_t ext;
+        xcb_get_property_reply_t     *pr = x11_reply ( pc[i].sequence, NULL );
+        xcb_get_property_reply_t     *sr = x11_reply ( sc[i].sequence, NULL );
+        // _NET_WM_STRUT_PARTIAL takes precedence, _NET_WM_STRUT spans the full edge.
+        if ( pr && xcb_ewmh_get_wm_strut_partial_from_reply ( &st, pr ) ) {
+            mmb_screen_apply_strut ( mmc, &st );
+        }
+        else if ( sr && xcb_ewmh_get_wm_strut_from_reply ( &ext, sr ) ) {
+            memset ( &st, 0, sizeof ( st ) );
+            st.left       = ext.left;
+            st.right      = ext.right;
+            st.top        = ext.top;
+            st.bottom     = ext.bottom;
+            st.left_end_y = st.right_end_y = mmc->base.h - 1;
+            st.top_end_x  = st.bottom_end_x = mmc->base.w - 1;
+            mmb_screen_apply_strut ( mmc, &st );
+        }
+        free ( pr );
+        free ( sr );
+    }
+    free ( sc );
+    free ( pc );
+    xcb_ewmh_get_windows_reply_wipe ( &clients );
+}
+
+/**
+ * @param screen The MMB_Screen.
+ * @param w      The window geometry, in root window coordinates.
+ *
+ * @returns the monitor that holds the largest part of w, or -1 if it is on none.
+ */
+static int mmb_screen_get_monitor_for_rect ( MMB_Screen *screen, const MMB_Rectangle *w )
+{
+    int best      = -1;
+    int best_area = 0;
     for ( int i = 0; i < screen->num_monitors; i++ ) {
-        if ( INTERSECT ( screen->active_monitor.x, screen->active_monitor.y,
+        MMB_Rectangle *m = screen->monitors[i];
+        int           ow = MIN ( w->x + w->w, m->x + m->w ) - MAX ( w->x, m->x );
+        int           oh = MIN ( w->y + w->h, m->y + m->h ) - MAX ( w->y, m->y );
+        if ( ow > 0 && oh > 0 && ow * oh > best_area ) {
+            best      = i;
+            best_area = ow * oh;
+        }
+    }
+    return best;
+}
+
+/**
+ * @param screen The MMB_Screen.
+ * @param x      Horizontal position in root window coordinates.
+ * @param y      Vertical position in root window coordinates.
+ *
+ * @returns the monitor holding position x,y, or 0 if there is none.
+ */
+static int mmb_screen_get_monitor_at ( MMB_Screen *screen, int x, int y )
+{
+    for ( int i = 0; i < screen->num_monitors; i++ ) {
+        if ( INTERSECT ( x, y,
                          screen->monitors[i]->x,
                          screen->monitors[i]->y,
                          screen->monitors[i]->w,
@@ -336,37 +1109,83 @@ static int mmb_screen_get_active_monitor ( MMB_Screen *screen )
     return 0;
 }
 
-static void mmb_screen_print ( MMB_Screen *screen )
+static int mmb_screen_get_active_monitor ( MMB_Screen *screen )
+{
+    return mmb_screen_get_monitor_at ( screen, screen->active_monitor.x, screen->active_monitor.y );
+}
+
+static void mmb_screen_print ( MMB_Screen *screen, FILE *fp )
 {
-    printf ( "Total size:    %d %d\n", screen->base.w, screen->base.h );
-    printf ( "Num. monitors: %d\n", screen->num_monitors );
+    fprintf ( fp, "Total size:    %d %d\n", screen->base.w, screen->base.h );
+    fprintf ( fp, "Num. monitors: %d\n", screen->num_monitors );
 
     for ( int i = 0; i < screen->num_monitors; i++ ) {
-        printf ( "               %01d: %d %d -> %d %d (%s) %s\n",
-                 i,
-                 screen->monitors[i]->x,
-                 screen->monitors[i]->y,
-                 screen->monitors[i]->w,
-                 screen->monitors[i]->h,
-                 screen->monitors[i]->name,
-                 screen->monitors[i]->enabled ? "" : "(disabled)"
-                 );
+        fprintf ( fp, "               %01d: %d %d -> %d %d (%s) %s\n",
+                  i,
+                  screen->monitors[i]->x,
+                  screen->monitors[i]->y,
+                  screen->monitors[i]->w,
+                  screen->monitors[i]->h,
+                  screen->monitors[i]->name,
+                  screen->monitors[i]->enabled ? "" : "(disabled)"
+                  );
+        if ( screen->workarea_valid ) {
+            fprintf ( fp, "                  workarea: %d %d -> %d %d\n",
+                      screen->monitors[i]->wa_x,
+                      screen->monitors[i]->wa_y,
+                      screen->monitors[i]->wa_w,
+                      screen->monitors[i]->wa_h
+                      );
+        }
     }
 
     int active_monitor = mmb_screen_get_active_monitor ( screen );
-    printf ( "Active mon:    %d\n", active_monitor );
-    printf ( "               %d-%d\n", screen->active_monitor.x, screen->active_monitor.y );
+    fprintf ( fp, "Active mon:    %d\n", active_monitor );
+    fprintf ( fp, "               %d-%d\n", screen->active_monitor.x, screen->active_monitor.y );
+}
+
+/**
+ * @param screen The MMB_Screen to store.
+ *
+ * Store the layout, so it can be printed when the X server does not reply in time.
+ */
+static void mmb_screen_write_cache ( MMB_Screen *screen )
+{
+    char *path = layout_cache_path ();
+    char *tmp  = NULL;
+    if ( path == NULL ) {
+        return;
+    }
+    if ( asprintf ( &tmp, "%s.%d", path, getpid () ) >= 0 ) {
+        // Make sure the cache directory exists.
+        char *sep = strrchr ( tmp, '/' );
+        *sep = '\0';
+        mkdir ( tmp, 0700 );
+        *sep = '/';
+        FILE *fp = fopen ( tmp, "w" );
+        if ( fp != NULL ) {
+            mmb_screen_print ( screen, fp );
+            if ( fclose ( fp ) == 0 ) {
+                rename ( tmp, path );
+            }
+            else {
+                unlink ( tmp );
+            }
+        }
+        free ( tmp );
+    }
+    free ( path );
 }
 
 static void screensaver ( char **argv )
 {
     (void) ( argv );
-    if ( !x11_is_extension_present ( "MIT-SCREEN-SAVER" ) ) {
+    if ( !x11_is_extension_present ( &xcb_screensaver_id, NULL ) ) {
         printf ( "unavailable\n" );
         return;
     }
     xcb_screensaver_query_info_cookie_t c  = xcb_screensaver_query_info ( connection, screen->root );
-    xcb_screensaver_query_info_reply_t  *r = xcb_screensaver_query_info_reply ( connection, c, NULL );
+    xcb_screensaver_query_info_reply_t  *r = x11_reply ( c.sequence, NULL );
     if ( r ) {
         switch ( r->state )
         {
@@ -400,7 +1219,7 @@ static void dpms_state ( char **argv )
 {
     (void ) ( argv );
     xcb_dpms_capable_cookie_t c  = xcb_dpms_capable ( connection );
-    xcb_dpms_capable_reply_t  *r = xcb_dpms_capable_reply ( connection, c, NULL );
+    xcb_dpms_capable_reply_t  *r = x11_reply ( c.sequence, NULL );
 
     if ( r && r->capable == 0 ) {
         printf ( "incapable\n" );
@@ -409,7 +1228,7 @@ static void dpms_state ( char **argv )
     }
     free ( r );
     xcb_dpms_info_cookie_t ic  = xcb_dpms_info ( connection );
-    xcb_dpms_info_reply_t  *ir = xcb_dpms_info_reply ( connection, ic, NULL );
+    xcb_dpms_info_reply_t  *ir = x11_reply ( ic.sequence, NULL );
     if ( ir ) {
         if ( ir->state ) {
             switch ( ir->power_level )
@@ -442,7 +1261,7 @@ static void dpms_print ( char ** argv )
 {
     (void ) ( argv );
     xcb_dpms_capable_cookie_t c  = xcb_dpms_capable ( connection );
-    xcb_dpms_capable_reply_t  *r = xcb_dpms_capable_reply ( connection, c, NULL );
+    xcb_dpms_capable_reply_t  *r = x11_reply ( c.sequence, NULL );
 
     if ( r && r->capable == 0 ) {
         printf ( "dpms:          incapable\n" );
@@ -451,7 +1270,7 @@ static void dpms_print ( char ** argv )
     }
     free ( r );
     xcb_dpms_info_cookie_t ic  = xcb_dpms_info ( connection );
-    xcb_dpms_info_reply_t  *ir = xcb_dpms_info_reply ( connection, ic, NULL );
+    xcb_dpms_info_reply_t  *ir = x11_reply ( ic.sequence, NULL );
     if ( ir ) {
         if ( ir->state ) {
             printf ( "dpms:          capable\nstate:         " );
@@ -505,6 +1324,55 @@ static void print_active_mon ( char **argv )
     int active_mon = mmb_screen_get_active_monitor ( mmb_screen );
     printf ( "%d\n", active_mon );
 }
+static void print_active_mon_all_seats ( char **argv )
+{
+    (void ) ( argv );
+    if ( !x11_is_extension_present ( &xcb_input_id, NULL ) ) {
+        printf ( "unavailable\n" );
+        return;
+    }
+    // The server processes these in order, so the version is announced before the device query.
+    xcb_input_xi_query_version_cookie_t vc = xcb_input_xi_query_version ( connection, 2, 0 );
+    xcb_input_xi_query_device_cookie_t  dc = xcb_input_xi_query_device ( connection, XCB_INPUT_DEVICE_ALL_MASTER );
+    free ( x11_reply ( vc.sequence, NULL ) );
+    xcb_input_xi_query_device_reply_t *dr = x11_reply ( dc.sequence, NULL );
+    if ( dr == NULL ) {
+        printf ( "unavailable\n" );
+        return;
+    }
+
+    // Send all requests before waiting on any reply.
+    int                                 num_devices = xcb_input_xi_query_device_infos_length ( dr );
+    xcb_input_xi_device_info_t          **devices   = malloc ( num_devices * sizeof ( xcb_input_xi_device_info_t * ) );
+    xcb_input_xi_query_pointer_cookie_t *pc         = malloc ( num_devices * sizeof ( xcb_input_xi_query_pointer_cookie_t ) );
+    int                                 num_ptrs    = 0;
+    for ( xcb_input_xi_device_info_iterator_t it = xcb_input_xi_query_device_infos_iterator ( dr );
+          it.rem > 0; xcb_input_xi_device_info_next ( &it ) ) {
+        if ( it.data->type == XCB_INPUT_DEVICE_TYPE_MASTER_POINTER ) {
+            devices[num_ptrs] = it.data;
+            pc[num_ptrs]      = xcb_input_xi_query_pointer ( connection, screen->root, it.data->deviceid );
+            num_ptrs++;
+        }
+    }
+    for ( int i = 0; i < num_ptrs; i++ ) {
+        xcb_input_xi_query_pointer_reply_t *r = x11_reply ( pc[i].sequence, NULL );
+        if ( r ) {
+            // Positions are 16.16 fixed point.
+            int x = r->root_x >> 16;
+            int y = r->root_y >> 16;
+            printf ( "%d %d %d %d %.*s\n",
+                     devices[i]->deviceid,
+                     mmb_screen_get_monitor_at ( mmb_screen, x, y ),
+                     x, y,
+                     xcb_input_xi_device_info_name_length ( devices[i] ),
+                     xcb_input_xi_device_info_name ( devices[i] ) );
+            free ( r );
+        }
+    }
+    free ( pc );
+    free ( devices );
+    free ( dr );
+}
 static void print_mon_size ( char **argv )
 {
     (void ) ( argv );
@@ -531,6 +1399,13 @@ static void print_mon_y ( char **argv )
     printf ( "%d\n", selected_mon->y );
 }
 
+static void print_mon_workarea ( char **argv )
+{
+    (void ) ( argv );
+    mmb_screen_get_workarea ( mmb_screen );
+    printf ( "%i %i %i %i\n", selected_mon->wa_x, selected_mon->wa_y, selected_mon->wa_w, selected_mon->wa_h );
+}
+
 static void print_mon_pos ( char **argv )
 {
     (void ) ( argv );
@@ -576,16 +1451,104 @@ static void print_num_mon ( char **argv )
 static void print ( char **argv )
 {
     (void ) ( argv );
-    mmb_screen_print ( mmb_screen );
+    mmb_screen_get_workarea ( mmb_screen );
+    mmb_screen_print ( mmb_screen, stdout );
+}
+
+static void print_windows ( char **argv )
+{
+    (void ) ( argv );
+    xcb_ewmh_get_windows_reply_t clients;
+    if ( !x11_get_client_list ( &clients ) ) {
+        fprintf ( stderr, "Window manager does not provide a client list.\n" );
+        return;
+    }
+    // Send all requests before waiting on any reply.
+    xcb_get_geometry_cookie_t          *gc = malloc ( clients.windows_len * sizeof ( xcb_get_geometry_cookie_t ) );
+    xcb_translate_coordinates_cookie_t *tc = malloc ( clients.windows_len * sizeof ( xcb_translate_coordinates_cookie_t ) );
+    for ( unsigned int i = 0; i < clients.windows_len; i++ ) {
+        gc[i] = xcb_get_geometry ( connection, clients.windows[i] );
+        tc[i] = xcb_translate_coordinates ( connection, clients.windows[i], screen->root, 0, 0 );
+    }
+    for ( unsigned int i = 0; i < clients.windows_len; i++ ) {
+        xcb_get_geometry_reply_t          *gr = x11_reply ( gc[i].sequence, NULL );
+        xcb_translate_coordinates_reply_t  *tr = x11_reply ( tc[i].sequence, NULL );
+        // Window can be gone by now.
+        if ( gr && tr ) {
+            MMB_Rectangle w;
+            memset ( &w, 0, sizeof ( w ) );
+            w.x = tr->dst_x;
+            w.y = tr->dst_y;
+            w.w = gr->width;
+            w.h = gr->height;
+            printf ( "0x%08x %d %d %d %d %d\n",
+                     clients.windows[i],
+                     mmb_screen_get_monitor_for_rect ( mmb_screen, &w ),
+                     w.x, w.y, w.w, w.h );
+        }
+        free ( gr );
+        free ( tr );
+    }
+    free ( tc );
+    free ( gc );
+    xcb_ewmh_get_windows_reply_wipe ( &clients );
 }
 
 static void print_mon_modes  ( char ** argv )
 {
     (void ) ( argv );
     for ( int i = 0; i < selected_mon->modes_len; i++ ) {
-        printf ( "%d %d @ %.2f\n", selected_mon->modes[i].w, selected_mon->modes[i].h, selected_mon->modes[i].rate );
+        // The drm backend only knows the rate of the preferred mode.
+        if ( selected_mon->modes[i].rate > 0 ) {
+            printf ( "%d %d @ %.2f\n", selected_mon->modes[i].w, selected_mon->modes[i].h, selected_mon->modes[i].rate );
+        }
+        else {
+            printf ( "%d %d\n", selected_mon->modes[i].w, selected_mon->modes[i].h );
+        }
+    }
+}
+static void set_timeout ( char **argv )
+{
+    char *end = NULL;
+    errno = 0;
+    long ms = strtol ( argv[1], &end, 10 );
+    if ( end == argv[1] || *end != '\0' || ms <= 0 ) {
+        fprintf ( stderr, "Invalid timeout: %s\n", argv[1] );
+        exit ( EXIT_FAILURE );
+    }
+    // poll takes an int.
+    if ( errno == ERANGE || ms > INT_MAX ) {
+        ms = INT_MAX;
+    }
+    reply_deadline = monotonic_ms () + ms;
+}
+static void set_backend ( char **argv )
+{
+    if ( strcmp ( argv[1], "drm" ) == 0 ) {
+        use_drm = TRUE;
+    }
+    else if ( strcmp ( argv[1], "x11" ) == 0 ) {
+        use_drm = FALSE;
+    }
+    else {
+        fprintf ( stderr, "Invalid backend: %s (x11 or drm)\n", argv[1] );
+        exit ( EXIT_FAILURE );
     }
 }
+static void set_drm_root ( char **argv )
+{
+    drm_root = argv[1];
+}
+static void set_timeout_cache ( char **argv )
+{
+    (void ) ( argv );
+    timeout_cache = TRUE;
+}
+// Options that are applied in setup, skipped when handling the commands.
+static void skip_option ( char **argv )
+{
+    (void ) ( argv );
+}
 static void print_help ( char ** );
 typedef struct _CmdOptions
 {
@@ -593,6 +1556,10 @@ typedef struct _CmdOptions
     const int  n_args;
     void ( *callback )( char **start );
     const char *description;
+    // Option queries the X server, not available with the drm backend.
+    const int  needs_x11;
+    // Called before connecting, the callback is called when handling the commands.
+    void ( *setup )( char **start );
 } CmdOptions;
 
 static const CmdOptions options[] = {
@@ -608,6 +1575,13 @@ static const CmdOptions options[] = {
         .callback    = print_active_mon,
         .description = "Print the monitor id indicated by the window manager to hold the focus."
     },
+    {
+        .handle      = "-active-mon-all-seats",
+        .n_args      = 0,
+        .callback    = print_active_mon_all_seats,
+        .description = "Print the monitor of each master pointer (device monitor x y name).",
+        .needs_x11   = TRUE
+    },
     {
         .handle      = "-mon-size",
         .n_args      = 0,
@@ -656,6 +1630,12 @@ static const CmdOptions options[] = {
         .callback    = print_mon_pos,
         .description = "Get the selected monitor position (x y)."
     },
+    {
+        .handle      = "-mon-workarea",
+        .n_args      = 0,
+        .callback    = print_mon_workarea,
+        .description = "Get the usable area of the selected monitor, without panels (x y width height)."
+    },
     {
         .handle      = "-num-mon",
         .n_args      = 0,
@@ -666,25 +1646,29 @@ static const CmdOptions options[] = {
         .handle      = "-dpms",
         .n_args      = 0,
         .callback    = dpms_print,
-        .description = "Get the dpms state."
+        .description = "Get the dpms state.",
+        .needs_x11   = TRUE
     },
     {
         .handle      = "-dpms-state",
         .n_args      = 0,
         .callback    = dpms_state,
-        .description = "Get the dpms state (parsable)."
+        .description = "Get the dpms state (parsable).",
+        .needs_x11   = TRUE
     },
     {
         .handle      = "-screensaver",
         .n_args      = 0,
         .callback    = screensaver_print,
-        .description = "Get the screensaver state."
+        .description = "Get the screensaver state.",
+        .needs_x11   = TRUE
     },
     {
         .handle      = "-screensaver-state",
         .n_args      = 0,
         .callback    = screensaver,
-        .description = "Get the screensaver state (parsable)"
+        .description = "Get the screensaver state (parsable)",
+        .needs_x11   = TRUE
     },
     {
         .handle      = "-print",
@@ -705,6 +1689,41 @@ static const CmdOptions options[] = {
         .description = "Print monitors supported modes."
     },
 
+    {
+        .handle      = "-windows",
+        .n_args      = 0,
+        .callback    = print_windows,
+        .description = "Print each managed window and the monitor it is on (window monitor x y width height).",
+        .needs_x11   = TRUE
+    },
+    {
+        .handle      = "-timeout",
+        .n_args      = 1,
+        .callback    = skip_option,
+        .description = "Give up when the X server did not reply within the timeout (ms). Exits with status 2.",
+        .setup       = set_timeout
+    },
+    {
+        .handle      = "-timeout-cache",
+        .n_args      = 0,
+        .callback    = skip_option,
+        .description = "On timeout, print the last known layout (-print format) from the cache.",
+        .setup       = set_timeout_cache
+    },
+    {
+        .handle      = "-backend",
+        .n_args      = 1,
+        .callback    = skip_option,
+        .description = "Get the monitors from the X server (x11) or sysfs (drm). Default drm if DISPLAY is not set.",
+        .setup       = set_backend
+    },
+    {
+        .handle      = "-drm-root",
+        .n_args      = 1,
+        .callback    = skip_option,
+        .description = "Directory with the DRM connectors used by the drm backend (default /sys/class/drm).",
+        .setup       = set_drm_root
+    },
     {
         .handle      = "-h",
         .n_args      = 0,
@@ -728,33 +1747,45 @@ static void print_help ( char **argv )
     printf ( "These arguments can be chained, e.g. xininfo -monitor 1 -mon-size -monitor 2 -mon-size.\n" );
     printf ( "Will print first the size of monitor 1 then monitor 2.\n" );
 }
+static const CmdOptions *find_option ( const char *handle )
+{
+    for ( unsigned int i = 0; i < num_options; i++ ) {
+        if ( strcmp ( options[i].handle, handle ) == 0 ) {
+            return &options[i];
+        }
+    }
+    return NULL;
+}
 /**
  *  Function to handle arguments.
  */
 static int handle_arg ( int argc, char **argv )
 {
-    for ( unsigned int i = 0; i < num_options; i++ ) {
-        if ( strcmp ( options[i].handle, argv[0] ) == 0 ) {
-            if ( argc > options[i].n_args ) {
-                options[i].callback ( argv );
-                return options[i].n_args;
-            }
-            else {
-                fprintf ( stderr, "Option: %s requires %d arguments.\n", options[i].handle, options[i].n_args );
-                exit ( EXIT_FAILURE );
-            }
-        }
+    const CmdOptions *option = find_option ( argv[0] );
+    if ( option == NULL ) {
+        fprintf ( stderr, "Commandline option: '%s' not found.\n", argv[0] );
+        return 0;
     }
-    fprintf ( stderr, "Commandline option: '%s' not found.\n", argv[0] );
-    return 0;
+    if ( argc <= option->n_args ) {
+        fprintf ( stderr, "Option: %s requires %d arguments.\n", option->handle, option->n_args );
+        exit ( EXIT_FAILURE );
+    }
+    if ( option->needs_x11 && use_drm ) {
+        fprintf ( stderr, "Option: %s is not available with the drm backend.\n", option->handle );
+        exit ( EXIT_FAILURE );
+    }
+    option->callback ( argv );
+    return option->n_args;
 }
 
 static void cleanup ( void )
 {
     // Cleanup
     mmb_screen_free ( &mmb_screen );
-    xcb_ewmh_connection_wipe ( &( ewmh ) );
-    xcb_disconnect ( connection );
+    if ( connection != NULL ) {
+        xcb_ewmh_connection_wipe ( &( ewmh ) );
+        xcb_disconnect ( connection );
+    }
 }
 
 int main ( int argc, char **argv )
@@ -763,33 +1794,67 @@ int main ( int argc, char **argv )
 
     // Get DISPLAY
     const char *display_str = getenv ( "DISPLAY" );
-    connection = xcb_connect ( display_str, &screen_nbr );
-    if ( xcb_connection_has_error ( connection ) ) {
-        fprintf ( stderr, "Failed to open display: %s", display_str );
-        return EXIT_FAILURE;
+    // Without a display, fall back to sysfs.
+    use_drm = ( display_str == NULL || display_str[0] == '\0' );
+
+    // Options that change how we connect. The deadline is shared by all requests, so set it up before the first one.
+    for ( int ac = 1; ac < argc; ac++ ) {
+        const CmdOptions *option = find_option ( argv[ac] );
+        if ( option == NULL ) {
+            continue;
+        }
+        if ( option->setup != NULL && ( argc - ac ) > option->n_args ) {
+            option->setup ( &argv[ac] );
+        }
+        // Skip the arguments, so they are not taken for an option.
+        ac += option->n_args;
     }
-    xcb_intern_atom_cookie_t *ac     = xcb_ewmh_init_atoms ( connection, &ewmh );
-    xcb_generic_error_t      *errors = NULL;
-    xcb_ewmh_init_atoms_replies ( &ewmh, ac, &errors );
-    if ( errors ) {
-        fprintf ( stderr, "Failed to create EWMH atoms\n" );
-        free ( errors );
+
+    if ( use_drm ) {
+        mmb_screen = mmb_screen_create_drm ();
     }
+    else {
+        connection = xcb_connect ( display_str, &screen_nbr );
+        if ( xcb_connection_has_error ( connection ) ) {
+            fprintf ( stderr, "Failed to open display: %s", display_str );
+            return EXIT_FAILURE;
+        }
+        xcb_intern_atom_cookie_t *ac     = xcb_ewmh_init_atoms ( connection, &ewmh );
+        xcb_generic_error_t      *errors = NULL;
+        // Query all extensions up front, libxcb would otherwise do so blocking on first use.
+        xcb_prefetch_extension_data ( connection, &xcb_randr_id );
+        xcb_prefetch_extension_data ( connection, &xcb_xinerama_id );
+        xcb_prefetch_extension_data ( connection, &xcb_dpms_id );
+        xcb_prefetch_extension_data ( connection, &xcb_screensaver_id );
+        xcb_prefetch_extension_data ( connection, &xcb_input_id );
+        // Replies arrive in order, once this one is in the atom and extension replies will not block.
+        xcb_get_input_focus_cookie_t sync = xcb_get_input_focus ( connection );
+        free ( x11_reply ( sync.sequence, NULL ) );
+        xcb_ewmh_init_atoms_replies ( &ewmh, ac, &errors );
+        if ( errors ) {
+            fprintf ( stderr, "Failed to create EWMH atoms\n" );
+            free ( errors );
+        }
 
-    // Get monitor layout. (xinerama aware)
-    mmb_screen = mmb_screen_create ( screen_nbr );
+        // Get monitor layout. (xinerama aware)
+        mmb_screen = mmb_screen_create ( screen_nbr );
+    }
 
     if ( mmb_screen->num_monitors == 0 ) {
         fprintf ( stderr, "No monitor found.\n" );
         return EXIT_FAILURE;
     }
-
     monitor_pos  = mmb_screen_get_active_monitor ( mmb_screen );
     selected_mon = mmb_screen->monitors[monitor_pos];
 
+    commands_started = TRUE;
     for ( int ac = 1; ac < argc; ac++ ) {
         //
         ac += handle_arg ( argc - ac, &argv[ac] );
     }
+    // Only cache what the X server reported, with the workarea if a command needed it.
+    if ( timeout_cache && !use_drm ) {
+        mmb_screen_write_cache ( mmb_screen );
+    }
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,5 @@
+#!/bin/sh
+# Check the drm backend (status, modes and EDID parsing) against the fixture connectors.
+srcdir=${srcdir:-.}
+./xininfo -backend drm -drm-root "${srcdir}/test/drm" -print -monitor 0 -name -modes -monitor 1 -name -modes |
+    diff -u "${srcdir}/test/drm.expected" -